@@ -29,33 +29,146 @@
 #include <vector>
 #include <map>
 #include <sstream>
+#include <cstdlib>
+#include <climits>
 
 void howto(void) {
 	std::cout << "gcovr - gcov html report generator" << std::endl;
 	std::cout << " gcov input-files" << std::endl;
+	std::cout << "   input-files: .gcov files and/or lcov tracefiles (.info)" << std::endl;
+	std::cout << " options" << std::endl;
+	std::cout << "   --history <file>  show coverage trends from the history file" << std::endl;
+	std::cout << "   --build-id <id>   record this run in the history file as <id>" << std::endl;
+	std::cout << "   --trend <n>       number of builds in trends (default: 16)" << std::endl;
+	std::cout << "   --uncovered <n>   report only uncovered lines with <n> lines of context" << std::endl;
+	std::cout << "   --full-pages      write only the full pages linked from --uncovered reports" << std::endl;
+	std::cout << "   --check <config>  only check line coverage against thresholds in <config>," << std::endl;
+	std::cout << "                     print the result as json and exit with 1 on violation" << std::endl;
 }
 
 using gcovh::coverage_data;
 
 typedef std::vector<coverage_data> sources_t;
+typedef std::vector<gcovh::line_count> counts_t;
+
+// "12" -> 12, false unless the whole argument is a number not less than min
+bool parse_number(const char *arg, long min, long& value) {
+	char *end;
+
+	value = strtol(arg, &end, 10);
+	return end != arg && *end == '\0' && value >= min;
+}
+
+// writes the report of each source as it is parsed, keeping only counts for the summary
+class report_writer {
+public:
+	report_writer(sources_t& summary, long context_lines, bool full_pages)
+		: summary_(summary), context_lines_(context_lines), full_pages_(full_pages) {}
+
+	void operator () (coverage_data cov) {
+		if (full_pages_)
+			gcovh::generate_full_report(cov);
+		else if (context_lines_ >= 0)
+			gcovh::generate_uncovered_report(cov, (int)context_lines_);
+		else
+			gcovh::generate_coverage_report(cov);
+
+		cov.clear_source();
+		summary_.push_back(cov);
+	}
+
+private:
+	sources_t& summary_;
+	long       context_lines_;
+	bool       full_pages_;
+};
+
+int check (int num, char *path[], const std::string& config) {
+	counts_t counts;
+	std::vector<const char*> tracefiles;
+
+	for (int i = 0; i < num; i++) {
+		if (gcovh::detail::has_extension(path[i], ".info"))
+			tracefiles.push_back(path[i]);
+		else
+			counts.push_back(gcovh::count(path[i]));
+	}
+
+	if (!tracefiles.empty()) {
+		counts_t traced = gcovh::count_lcov((int)tracefiles.size(), &tracefiles[0]);
+		counts.insert(counts.end(), traced.begin(), traced.end());
+	}
+
+	std::vector<gcovh::threshold_result> results = gcovh::check_thresholds(counts, gcovh::load_thresholds(config.c_str()));
+
+	return gcovh::write_check_result(stdout, counts, results) ? 0 : 1;
+}
 
 int main (int argc, char *argv[]) {
-	if (argc < 2) {
+	std::string history_file, build_id, check_config;
+	long trend_length = 16;
+	long context_lines = -1;
+	bool full_pages = false;
+	bool valid = true;
+	int i = 1;
+
+	for (; valid && i < argc && std::string(argv[i]).compare(0, 2, "--") == 0; i++) {
+		std::string opt = argv[i];
+
+		if (opt == "--full-pages")
+			full_pages = true;
+		else if (i + 1 >= argc)
+			valid = false;
+		else if (opt == "--history")
+			history_file = argv[++i];
+		else if (opt == "--build-id")
+			build_id = argv[++i];
+		else if (opt == "--trend")
+			valid = parse_number(argv[++i], 1, trend_length);
+		else if (opt == "--uncovered")
+			valid = parse_number(argv[++i], 0, context_lines) && context_lines <= INT_MAX;
+		else if (opt == "--check")
+			check_config = argv[++i];
+		else
+			valid = false;
+	}
+
+	if (!valid || i >= argc || (!build_id.empty() && history_file.empty())) {
 		std::cerr << "error: invalid arg" << std::endl;
+		howto();
 		return -1;
 	}
 
 	try {
+		if (!check_config.empty())
+			return check(argc - i, &argv[i], check_config);
+
 		sources_t sources;
+		std::vector<const char*> tracefiles;
+		report_writer writer(sources, context_lines, full_pages);
 
-		for (int i = 1; i < argc; i++) {
-			sources.push_back(gcovh::parse(argv[i]));
+		for (; i < argc; i++) {
+			if (gcovh::detail::has_extension(argv[i], ".info"))
+				tracefiles.push_back(argv[i]);
+			else
+				writer(gcovh::parse(argv[i]));
 		}
 
-		for (sources_t::iterator it = sources.begin(), end = sources.end(); it != end; ++it) {
-			gcovh::generate_coverage_report((*it));
+		if (!tracefiles.empty())
+			gcovh::parse_lcov((int)tracefiles.size(), &tracefiles[0], writer);
+
+		if (full_pages)
+			return 0;
+
+		if (history_file.empty()) {
+			gcovh::generate_coverage_summary(sources);
+		} else {
+			gcovh::coverage_history history(history_file);
+
+			if (!build_id.empty())
+				history.append(build_id, sources);
+			gcovh::generate_coverage_summary(sources, history, trend_length);
 		}
-		gcovh::generate_coverage_summary(sources);
 	} catch (const std::exception& e) {
 		std::cerr << e.what() << std::endl;
 		exit(-1);
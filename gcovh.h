@@ -32,10 +32,33 @@
 #include <map>
 #include <string>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
 #include <sstream>
 #include <stdexcept>
 #include <typeinfo>
 #include <algorithm>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <iterator>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 namespace gcovh {
 namespace detail {
@@ -70,6 +93,32 @@ std::string get_filebase(const std::string& filename) {
 	return merge(s.begin(), s.end() - 1, '.');
 }
 
+// dir/foo.c -> foo.c
+std::string get_filename(const std::string& path) {
+	size_t sep = path.find_last_of("/\\");
+	return sep == std::string::npos ? path : path.substr(sep + 1);
+}
+
+// foo.c.gcov -> foo.c.full.html
+std::string get_full_report_file(const std::string& parse_file) {
+	return get_filebase(parse_file) + ".full.html";
+}
+
+// foo.info, .info -> true
+bool has_extension(const std::string& filename, const std::string& ext) {
+	return filename.length() >= ext.length() &&
+		filename.compare(filename.length() - ext.length(), ext.length(), ext) == 0;
+}
+
+// /usr/src/foo.c -> usr_src_foo.c
+std::string flatten_path(const std::string& path) {
+	std::string flat = path.substr(std::min(path.find_first_not_of("/\\"), path.length()));
+	std::replace(flat.begin(), flat.end(), '/', '_');
+	std::replace(flat.begin(), flat.end(), '\\', '_');
+	std::replace(flat.begin(), flat.end(), ':', '_');
+	return flat;
+}
+
 std::string trim_begin(const std::string& str) {
 	return str.substr(str.find_first_not_of(' '));
 }
@@ -110,6 +159,201 @@ std::string escape_for_html(const std::string& base) {
 	return escaped;
 }
 
+std::string escape_for_json(const std::string& base) {
+	std::string escaped;
+
+	for (size_t i = 0; i < base.length(); i++) {
+		unsigned char c = base[i];
+		char buf[8];
+
+		if (c == '\\' || c == '"') {
+			escaped += '\\';
+			escaped += c;
+		} else if (c < 0x20) {
+			sprintf(buf, "\\u%04x", c);
+			escaped += buf;
+		} else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+// 0 -> "#####", as gcov marks lines never executed
+std::string exec_count_string(long long count) {
+	char buf[32];
+
+	if (count == 0)
+		return "#####";
+	sprintf(buf, "%lld", count);
+	return buf;
+}
+
+// 64bit FNV-1a
+uint64_t hash_string(const std::string& s) {
+	uint64_t h = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < s.length(); i++) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// read-only view of a whole file (memory mapped where available)
+class mapped_file {
+public:
+	mapped_file() : data_(0), size_(0) {}
+
+	~mapped_file() {
+		close();
+	}
+
+	void open(const std::string& path) {
+		close();
+#ifdef _WIN32
+		std::ifstream ifs(path.c_str(), std::ios::binary);
+		buffer_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+		data_ = buffer_.empty() ? 0 : &buffer_[0];
+		size_ = buffer_.size();
+#else
+		struct stat st;
+		int fd = ::open(path.c_str(), O_RDONLY);
+
+		if (fd < 0)
+			return; // no file yet, same as an empty one
+
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED) {
+				data_ = static_cast<const char*>(p);
+				size_ = st.st_size;
+			}
+		}
+		::close(fd);
+#endif
+	}
+
+	void close() {
+#ifdef _WIN32
+		buffer_.clear();
+#else
+		if (data_)
+			munmap(const_cast<char*>(data_), size_);
+#endif
+		data_ = 0;
+		size_ = 0;
+	}
+
+	const char* data(void) const {
+		return data_;
+	}
+
+	size_t size(void) const {
+		return size_;
+	}
+
+private:
+	mapped_file(const mapped_file&);
+	mapped_file& operator = (const mapped_file&);
+
+	const char *data_;
+	size_t      size_;
+#ifdef _WIN32
+	std::vector<char> buffer_;
+#endif
+};
+
+// a file held under an advisory lock, shared for reading or exclusive for writing.
+// the lock is released when the file is closed.
+class locked_file {
+public:
+	// a shared lock on a missing file leaves it closed; an exclusive one creates the file
+	locked_file(const std::string& path, bool exclusive) : fd_(-1) {
+#ifdef _WIN32
+		fd_ = _open(path.c_str(), exclusive ? (_O_RDWR | _O_CREAT | _O_BINARY) : (_O_RDONLY | _O_BINARY), _S_IREAD | _S_IWRITE);
+		if (fd_ < 0)
+			return;
+
+		// windows locks are mandatory, so lock a byte far beyond the data instead of the data itself
+		OVERLAPPED ov = { 0 };
+		ov.OffsetHigh = MAXDWORD;
+		bool locked = LockFileEx((HANDLE)_get_osfhandle(fd_), exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &ov) != 0;
+#else
+		fd_ = ::open(path.c_str(), exclusive ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+		if (fd_ < 0)
+			return;
+
+		bool locked = flock(fd_, exclusive ? LOCK_EX : LOCK_SH) == 0;
+#endif
+		if (!locked) {
+			close();
+			throw std::runtime_error(std::string("failed to lock file ") + path);
+		}
+	}
+
+	~locked_file() {
+		close();
+	}
+
+	bool is_open(void) const {
+		return fd_ >= 0;
+	}
+
+	bool truncate(size_t size) {
+#ifdef _WIN32
+		return _chsize(fd_, (long)size) == 0;
+#else
+		return ftruncate(fd_, size) == 0;
+#endif
+	}
+
+	// write all of data at the end of the file
+	bool append(const void *data, size_t size) {
+		const char *p = static_cast<const char*>(data);
+
+#ifdef _WIN32
+		if (_lseek(fd_, 0, SEEK_END) < 0)
+			return false;
+		while (size > 0) {
+			int n = _write(fd_, p, (unsigned int)std::min(size, (size_t)INT_MAX));
+#else
+		if (lseek(fd_, 0, SEEK_END) < 0)
+			return false;
+		while (size > 0) {
+			ssize_t n = ::write(fd_, p, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+#endif
+			if (n <= 0)
+				return false;
+			p    += n;
+			size -= n;
+		}
+		return true;
+	}
+
+private:
+	locked_file(const locked_file&);
+	locked_file& operator = (const locked_file&);
+
+	void close() {
+		if (fd_ < 0)
+			return;
+#ifdef _WIN32
+		OVERLAPPED ov = { 0 };
+		ov.OffsetHigh = MAXDWORD;
+		UnlockFileEx((HANDLE)_get_osfhandle(fd_), 0, 1, 0, &ov);
+		_close(fd_);
+#else
+		::close(fd_);
+#endif
+		fd_ = -1;
+	}
+
+	int fd_;
+};
+
 } // namespace detail
 
 //-------------------------------------------------
@@ -155,7 +399,8 @@ class coverage_data {
 public:
 	coverage_data(const std::string& parse_file) 
 		: parse_file_(parse_file), source_file_("N/A"), graph_file_("N/A"), data_file_("N/A"),
-		runs_(0), programs_(0), lines_executed_(0), lines_total_(0), line_coverage_(0.0) {}
+		runs_(0), programs_(0), lines_executed_(0), lines_total_(0), line_coverage_(0.0),
+		functions_executed_(0), functions_total_(0), branches_taken_(0), branches_total_(0) {}
 
 	void add (const source_line& line) {
 		contents_.push_back(line);
@@ -167,6 +412,18 @@ public:
 		}
 	}
 
+	void add_function(bool executed) {
+		if (executed)
+			functions_executed_++;
+		functions_total_++;
+	}
+
+	void add_branch(bool taken) {
+		if (taken)
+			branches_taken_++;
+		branches_total_++;
+	}
+
 	void set_header(const std::string& tag, const std::string& value) {
 		if (tag == "Source") 
 			source_file_ = value;
@@ -210,10 +467,31 @@ public:
 		return line_coverage_;
 	}
 
+	int functions_executed(void) const {
+		return functions_executed_;
+	}
+
+	int functions_total(void) const {
+		return functions_total_;
+	}
+
+	int branches_taken(void) const {
+		return branches_taken_;
+	}
+
+	int branches_total(void) const {
+		return branches_total_;
+	}
+
 	const source_lines& all(void) const {
 		return contents_;
 	}
 
+	// free the source text once its report is written, keeping the counts
+	void clear_source(void) {
+		source_lines().swap(contents_);
+	}
+
 private:
 	std::string   parse_file_;
 	std::string   source_file_;
@@ -224,6 +502,10 @@ private:
 	int           lines_executed_;
 	int           lines_total_;
 	double        line_coverage_;
+	int           functions_executed_;
+	int           functions_total_;
+	int           branches_taken_;
+	int           branches_total_;
 	source_lines  contents_;
 
 	void update_coverage(void) {
@@ -233,6 +515,200 @@ private:
 	}
 };
 
+// line counts of a source file, without the source itself
+struct line_count {
+	std::string source_file;
+	int         lines_executed;
+	int         lines_total;
+};
+
+//-------------------------------------------------
+// coverage history
+
+// append-only file of per-file line counts, one block per build:
+//   [block] magic, number of entries, build id
+//   [entry] hash of source_file(), lines executed, lines total
+// entries of a block are sorted by hash, so looking a file up in a build is
+// a binary search over the mapped file. the layout is in native byte order.
+class coverage_history {
+public:
+	struct point {
+		std::string build_id;
+		int         lines_executed;
+		int         lines_total;
+		bool        found;
+	};
+
+	coverage_history(const std::string& path) : path_(path), valid_size_(0) {
+		detail::locked_file lock(path_, false);
+
+		if (lock.is_open())
+			load();
+	}
+
+	// record coverages as a new build at the end of the file
+	void append(const std::string& build_id, const std::vector<coverage_data>& coverages) {
+		block_header header = { magic, 0, {0} };
+		std::vector<entry> entries;
+
+		if (build_id.length() >= sizeof(header.build_id))
+			throw std::invalid_argument("build id longer than " +
+				detail::lexical_cast<std::string>(sizeof(header.build_id) - 1) + " characters: " + build_id);
+
+		for (std::vector<coverage_data>::const_iterator it = coverages.begin(), end = coverages.end(); it != end; ++it) {
+			entry e = { detail::hash_string(it->source_file()), it->lines_executed(), it->lines_total() };
+			entries.push_back(e);
+		}
+		std::sort(entries.begin(), entries.end(), entry_less);
+
+		// a header is listed once per translation unit; record the file as their sum
+		std::vector<entry> merged;
+		for (std::vector<entry>::const_iterator it = entries.begin(), end = entries.end(); it != end; ++it) {
+			if (!merged.empty() && merged.back().key == it->key) {
+				merged.back().lines_executed += it->lines_executed;
+				merged.back().lines_total    += it->lines_total;
+			} else {
+				merged.push_back(*it);
+			}
+		}
+		entries.swap(merged);
+
+		header.count = (uint32_t)entries.size();
+		strncpy(header.build_id, build_id.c_str(), sizeof(header.build_id) - 1);
+
+		// the lock keeps other writers out until the block is complete
+		detail::locked_file lock(path_, true);
+		if (!lock.is_open())
+			throw std::invalid_argument(std::string("failed to open file ") + path_);
+
+		load(); // other processes may have appended since
+
+		// drop what an interrupted append left behind, or the new block would be unreachable
+		if (valid_size_ < file_.size()) {
+			unload();
+			if (!lock.truncate(valid_size_))
+				throw std::runtime_error(std::string("failed to truncate damaged file ") + path_);
+		}
+
+		bool ok = lock.append(&header, sizeof(header)) &&
+			(entries.empty() || lock.append(&entries[0], entries.size() * sizeof(entry)));
+
+		if (!ok)
+			throw std::runtime_error(std::string("failed to write file ") + path_);
+
+		load();
+	}
+
+	size_t builds(void) const {
+		return blocks_.size();
+	}
+
+	std::string build_id(size_t build) const {
+		const char *id = blocks_[build].header->build_id;
+		return std::string(id, strnlen(id, sizeof(blocks_[build].header->build_id)));
+	}
+
+	point find(size_t build, const std::string& source_file) const {
+		return find(build, detail::hash_string(source_file));
+	}
+
+	// the last (at most) n builds of source_file, oldest first
+	std::vector<point> trend(const std::string& source_file, size_t n) const {
+		std::vector<point> ret;
+		uint64_t key = detail::hash_string(source_file);
+
+		for (size_t i = blocks_.size() > n ? blocks_.size() - n : 0; i < blocks_.size(); i++)
+			ret.push_back(find(i, key));
+
+		return ret;
+	}
+
+private:
+	enum { magic = 0x48564347 }; // "GCVH"
+
+	struct block_header {
+		uint32_t magic;
+		uint32_t count;
+		char     build_id[24];
+	};
+
+	struct entry {
+		uint64_t key;
+		int32_t  lines_executed;
+		int32_t  lines_total;
+	};
+
+	struct block {
+		const block_header *header;
+		const entry        *entries;
+	};
+
+	static bool entry_less(const entry& a, const entry& b) {
+		return a.key < b.key;
+	}
+
+	void unload() {
+		blocks_.clear();
+		file_.close();
+	}
+
+	// must be called under the lock of the file
+	void load() {
+		size_t offset = 0;
+
+		unload();
+		file_.open(path_);
+
+		// a block cut short by an interrupted append is ignored, and cut off by the next append.
+		// a torn block always starts with its magic, so anything else is a damaged file.
+		while (offset < file_.size()) {
+			size_t rest = file_.size() - offset;
+			uint32_t m;
+
+			if (rest < sizeof(m))
+				break;
+
+			memcpy(&m, file_.data() + offset, sizeof(m));
+			if (m != magic) {
+				unload();
+				throw std::runtime_error(std::string("damaged history file ") + path_ +
+					" at offset " + detail::lexical_cast<std::string>(offset));
+			}
+
+			const block_header *header = reinterpret_cast<const block_header*>(file_.data() + offset);
+			if (rest < sizeof(block_header) || sizeof(block_header) + header->count * sizeof(entry) > rest)
+				break;
+
+			size_t next = offset + sizeof(block_header) + header->count * sizeof(entry);
+
+			block b = { header, reinterpret_cast<const entry*>(header + 1) };
+			blocks_.push_back(b);
+			offset = next;
+		}
+		valid_size_ = offset;
+	}
+
+	point find(size_t build, uint64_t key) const {
+		const block& b = blocks_[build];
+		const entry *last = b.entries + b.header->count;
+		entry target = { key, 0, 0 };
+		const entry *e = std::lower_bound(b.entries, last, target, entry_less);
+		point p = { build_id(build), 0, 0, false };
+
+		if (e != last && e->key == key) {
+			p.lines_executed = e->lines_executed;
+			p.lines_total    = e->lines_total;
+			p.found          = true;
+		}
+		return p;
+	}
+
+	std::string        path_;
+	detail::mapped_file file_;
+	std::vector<block> blocks_;
+	size_t             valid_size_;
+};
+
 //-------------------------------------------------
 // parser/html-generator
 
@@ -312,6 +788,244 @@ private:
 	InputStream is_;
 };
 
+// counts lines the same way as parser, but never splits or copies source text
+template<class InputStream>
+class count_parser {
+public:
+	count_parser(const std::string& parse_file) : is_(parse_file.c_str()) {}
+
+	line_count parse() {
+		line_count count = { "N/A", 0, 0 };
+		std::string s;
+
+		while (std::getline(is_, s)) {
+			// <execution_count>:<line_number>:...
+			size_t c1 = s.find(':');
+			if (c1 == std::string::npos)
+				continue;
+
+			char *end;
+			long line_number = strtol(s.c_str() + c1 + 1, &end, 10);
+			if (end == s.c_str() + c1 + 1)
+				continue;
+
+			size_t c2 = s.find(':', c1 + 1);
+			if (c2 == std::string::npos)
+				continue;
+
+			if (line_number == 0) {
+				// -:0:Source:<value>
+				size_t c3 = s.find(':', c2 + 1);
+				if (c3 != std::string::npos && s.compare(c2 + 1, c3 - c2 - 1, "Source") == 0)
+					count.source_file = s.substr(c3 + 1, s.find(':', c3 + 1) - c3 - 1);
+				continue;
+			}
+
+			if (memchr(s.c_str(), '-', c1))
+				continue; // not executable
+
+			size_t head = s.find_first_not_of(' ');
+			if (s[head] != '#')
+				count.lines_executed++;
+			count.lines_total++;
+		}
+
+		return count;
+	}
+
+private:
+	InputStream is_;
+};
+
+template<class InputStream>
+class lcov_parser {
+public:
+	// TN:<test name>
+	// SF:<source file>
+	// FN:<line number>[,<end line number>],<function name>
+	// FNDA:<execution count>,<function name>
+	// FNL:<index>,<line number>[,<end line number>]
+	// FNA:<index>,<execution count>,<function name>
+	// BRDA:<line number>,<block>,<branch>,<taken>
+	// DA:<line number>,<execution count>[,<checksum>]
+	// end_of_record
+	//
+	// records of the same source file are merged, so parse() can be called
+	// once per tracefile and result() gives the combined coverage.
+	void parse(const std::string& trace_file) {
+		InputStream is(trace_file.c_str());
+		std::string s;
+		record *current = 0;
+
+		if (is.fail())
+			throw std::invalid_argument(std::string("failed to open file ") + trace_file);
+
+		while (std::getline(is, s)) {
+			if (!s.empty() && s[s.length() - 1] == '\r')
+				s.erase(s.length() - 1);
+
+			size_t colon = s.find(':');
+
+			if (colon == std::string::npos) {
+				if (s == "end_of_record")
+					current = 0;
+				continue;
+			}
+
+			const char *value = s.c_str() + colon + 1;
+
+			if (s.compare(0, colon, "SF") == 0)
+				current = &records_[value];
+			else if (current == 0)
+				continue;
+			else if (s.compare(0, colon, "DA") == 0)
+				parse_da(*current, value);
+			else if (s.compare(0, colon, "FN") == 0)
+				parse_fn(*current, value);
+			else if (s.compare(0, colon, "FNDA") == 0)
+				parse_fnda(*current, value);
+			else if (s.compare(0, colon, "FNA") == 0)
+				parse_fna(*current, value);
+			// FNL only locates functions, which is not shown
+			else if (s.compare(0, colon, "BRDA") == 0)
+				parse_brda(*current, value);
+		}
+	}
+
+	// build coverage_data for every source file, reading its text from disk
+	std::vector<coverage_data> result() const {
+		std::vector<coverage_data> ret;
+
+		for (typename records_t::const_iterator it = records_.begin(), end = records_.end(); it != end; ++it)
+			ret.push_back(make_coverage(it->first, it->second));
+
+		return ret;
+	}
+
+	// pass coverage_data of each source file to f, reading one source at a time
+	template<class Function>
+	void for_each(Function& f) const {
+		for (typename records_t::const_iterator it = records_.begin(), end = records_.end(); it != end; ++it)
+			f(make_coverage(it->first, it->second));
+	}
+
+	// line counts of every source file, without reading the sources
+	std::vector<line_count> counts() const {
+		std::vector<line_count> ret;
+
+		for (typename records_t::const_iterator it = records_.begin(), end = records_.end(); it != end; ++it) {
+			line_count count = { it->first, 0, (int)it->second.lines.size() };
+
+			for (std::map<int, long long>::const_iterator da = it->second.lines.begin(); da != it->second.lines.end(); ++da) {
+				if (da->second != 0)
+					count.lines_executed++;
+			}
+			ret.push_back(count);
+		}
+
+		return ret;
+	}
+
+private:
+	struct record {
+		std::map<int, long long>         lines;
+		std::map<std::string, long long> functions;
+		std::map<std::string, long long> branches;
+	};
+	typedef std::map<std::string, record> records_t;
+
+	void parse_da(record& r, const char *value) {
+		char *end;
+		int line_number = strtol(value, &end, 10);
+
+		if (*end != ',' || line_number <= 0)
+			return;
+		r.lines[line_number] += strtoll(end + 1, 0, 10);
+	}
+
+	void parse_fn(record& r, const char *value) {
+		char *end;
+
+		strtol(value, &end, 10); // start line
+		if (*end != ',')
+			return;
+
+		// an end line is there only if the next field is all digits, as names may contain commas
+		const char *name = end + 1, *digits = name;
+		while (*digits >= '0' && *digits <= '9')
+			digits++;
+		if (digits != name && *digits == ',')
+			name = digits + 1;
+
+		r.functions[name]; // count stays 0 unless FNDA follows
+	}
+
+	void parse_fna(record& r, const char *value) {
+		char *end;
+
+		strtol(value, &end, 10); // index, names are already unique
+		if (*end != ',')
+			return;
+
+		long long count = strtoll(end + 1, &end, 10);
+		if (*end == ',')
+			r.functions[end + 1] += count;
+	}
+
+	void parse_fnda(record& r, const char *value) {
+		char *end;
+		long long count = strtoll(value, &end, 10);
+
+		if (*end == ',')
+			r.functions[end + 1] += count;
+	}
+
+	void parse_brda(record& r, const char *value) {
+		const char *taken = strrchr(value, ',');
+
+		if (!taken)
+			return;
+		// "-" means the branch was never evaluated
+		long long& count = r.branches[std::string(value, taken)];
+		if (taken[1] != '-')
+			count += strtoll(taken + 1, 0, 10);
+	}
+
+	static coverage_data make_coverage(const std::string& source_file, const record& r) {
+		coverage_data cov(detail::flatten_path(source_file) + ".gcov");
+		std::ifstream src(source_file.c_str());
+		std::map<int, long long>::const_iterator da = r.lines.begin(), da_end = r.lines.end();
+		std::string text;
+
+		cov.set_header("Source", source_file);
+
+		for (int n = 1; src && std::getline(src, text); n++) {
+			if (!text.empty() && text[text.length() - 1] == '\r')
+				text.erase(text.length() - 1);
+
+			if (da != da_end && da->first == n) {
+				cov.add(source_line(n, text, detail::exec_count_string(da->second)));
+				++da;
+			} else {
+				cov.add(source_line(n, text));
+			}
+		}
+
+		// source is missing or older than the tracefile
+		for (; da != da_end; ++da)
+			cov.add(source_line(da->first, "", detail::exec_count_string(da->second)));
+
+		for (std::map<std::string, long long>::const_iterator it = r.functions.begin(); it != r.functions.end(); ++it)
+			cov.add_function(it->second > 0);
+		for (std::map<std::string, long long>::const_iterator it = r.branches.begin(); it != r.branches.end(); ++it)
+			cov.add_branch(it->second > 0);
+
+		return cov;
+	}
+
+	records_t records_;
+};
+
 template <class Content>
 class html_generator {
 public:
@@ -368,7 +1082,7 @@ public:
 		write_annotated_source(fp, src);
 	}
 
-private:
+protected:
 	std::string page_title(const coverage_data& cov) {
 		return cov.source_file();
 	}
@@ -390,14 +1104,19 @@ private:
 			cov.lines_executed(),
 			cov.lines_total(),
 			cov.line_coverage());
+
+		if (cov.functions_total() > 0)
+			fprintf(fp, "  <p>Functions executed:%d of %d</p>\n", cov.functions_executed(), cov.functions_total());
+		if (cov.branches_total() > 0)
+			fprintf(fp, "  <p>Branches taken:%d of %d</p>\n", cov.branches_taken(), cov.branches_total());
 	}
 
 	void write_oneline(FILE *fp, const source_line& line) {
 		std::string content_escaped = detail::escape_for_html(line.content());
-		const char *str = content_escaped.c_str();
 
 		fprintf(fp,
-			"    <span class=\"lineNum\">%5d</span>%s%6s:%s%s\n",
+			"    <span class=\"lineNum\" id=\"L%d\">%5d</span>%s%6s:%s%s\n",
+			line.number(),
 			line.number(),
 			line.executable() ? (line.executed() ? "<span class = \"lineCov\">" : "<span class = \"lineNoCov\">" ) : "",
 			line.exec_count(),
@@ -406,12 +1125,77 @@ private:
 	}
 };
 
+// report with only the lines not executed and some context around them.
+// the rest is collapsed into links to the full report page.
+class uncovered_report_generator : public report_generator {
+public:
+	uncovered_report_generator(const std::string& path, int context_lines, const std::string& full_report)
+		: report_generator(path), context_lines_(context_lines), full_report_(full_report) {}
+
+	void write_content(FILE *fp, const coverage_data& src) {
+		write_linecoverage_summary(fp, src);
+		write_uncovered_source(fp, src);
+	}
+
+private:
+	static bool uncovered(const source_line& line) {
+		return line.executable() && !line.executed();
+	}
+
+	void write_uncovered_source(FILE *fp, const coverage_data& cov) {
+		const source_lines& lines = cov.all();
+		std::vector<bool> shown(lines.size(), false);
+
+		for (size_t i = 0; i < lines.size(); i++) {
+			if (!uncovered(lines[i]))
+				continue;
+			size_t first = i > (size_t)context_lines_ ? i - context_lines_ : 0;
+			size_t last  = std::min(i + context_lines_ + 1, lines.size());
+			std::fill(shown.begin() + first, shown.begin() + last, true);
+		}
+
+		fprintf(fp,
+			"<h2>Uncovered Source</h2>\n"
+			"  <pre class=\"source\">");
+		for (size_t i = 0; i < lines.size(); ) {
+			if (shown[i]) {
+				write_oneline(fp, lines[i++]);
+				continue;
+			}
+			size_t first = i;
+			while (i < lines.size() && !shown[i])
+				i++;
+			write_skipped(fp, lines[first], lines[i - 1]);
+		}
+
+		fprintf(fp, "</pre>");
+	}
+
+	void write_skipped(FILE *fp, const source_line& first, const source_line& last) {
+		fprintf(fp,
+			"    <a class=\"skipped\" href=\"%s#L%d\">... lines %d-%d ...</a>\n",
+			full_report_.c_str(),
+			first.number(),
+			first.number(),
+			last.number());
+	}
+
+	int         context_lines_;
+	std::string full_report_;
+};
+
 class summary_generator : public html_generator<std::vector<coverage_data> >{
 public:
 	typedef std::vector<coverage_data> coverages_t;
 
 	summary_generator(const std::string& path)
-		: html_generator<std::vector<coverage_data> >(path.c_str()) {}
+		: html_generator<std::vector<coverage_data> >(path.c_str()), history_(0), trend_length_(0) {}
+
+	// show the last trend_length builds of history next to each file
+	void set_history(const coverage_history *history, size_t trend_length) {
+		history_      = history;
+		trend_length_ = trend_length;
+	}
 
 	void write_content(FILE *fp, const coverages_t& coverages) {
 		write_coverages_summary(fp, coverages);
@@ -428,7 +1212,9 @@ private:
 			"  <tr>\n"
 			"    <th>FileName</th>\n"
 			"    <th colspan=3>Line Coverage</th>\n"
-			"  </tr>\n");
+			"%s"
+			"  </tr>\n",
+			history_ ? "    <th colspan=2>Trend</th>\n" : "");
 
 		for (coverages_t::const_iterator it = coverages.begin(), end = coverages.end(); it != end; ++it) {
 			const coverage_data& cov = (*it);
@@ -439,18 +1225,115 @@ private:
 				"    <td><a href=\"%s\">%s</a></td>\n"
 				"    <td><div class=\"progress\"><div class=\"bar\" style=\"width:%d&#37;;\"></div></div></td>\n"
 				"    <td>%.2f&#37;</td>\n"
-				"    <td>%d/%d</td>\n"
-				"  </tr>\n",
+				"    <td>%d/%d</td>\n",
 				html_file.c_str(),
 				cov.source_file().c_str(),
 				(int)(cov.line_coverage()),
 				cov.line_coverage(),
 				cov.lines_executed(),
 				cov.lines_total());
+
+			if (history_)
+				write_trend(fp, history_->trend(cov.source_file(), trend_length_));
+
+			fprintf(fp, "  </tr>\n");
 		}
 
 		fprintf(fp, "</table>");
 	}
+
+	static double coverage_of(const coverage_history::point& p) {
+		return p.lines_total == 0 ? 0.0 : 100.0 * p.lines_executed / p.lines_total;
+	}
+
+	// change from the previous build, and a sparkline of the whole trend
+	void write_trend(FILE *fp, const std::vector<coverage_history::point>& trend) {
+		size_t n = trend.size();
+
+		if (n >= 2 && trend[n - 1].found && trend[n - 2].found) {
+			double delta = coverage_of(trend[n - 1]) - coverage_of(trend[n - 2]);
+			fprintf(fp, "    <td class=\"%s\">%+.2f&#37;</td>\n", delta < 0 ? "trendDown" : "trendUp", delta);
+		} else {
+			fprintf(fp, "    <td></td>\n");
+		}
+
+		fprintf(fp, "    <td><span class=\"sparkline\">");
+		for (size_t i = 0; i < n; i++) {
+			if (trend[i].found)
+				fprintf(fp, "&#%d;", 9601 + (int)(coverage_of(trend[i]) * 7 / 100)); // U+2581..U+2588
+			else
+				fprintf(fp, "&nbsp;");
+		}
+		fprintf(fp, "</span></td>\n");
+	}
+
+	const coverage_history *history_;
+	size_t                  trend_length_;
+};
+
+//-------------------------------------------------
+// threshold check
+
+// one threshold per line, '#' starts a comment:
+//   <path prefix> <minimum line coverage in percent>
+// a prefix matches source files under that directory, "*" matches all files.
+// prefixes are compared with source paths as gcov/lcov recorded them, which
+// are absolute for lcov tracefiles.
+class threshold_config {
+public:
+	struct rule {
+		std::string prefix;
+		double      threshold;
+	};
+
+	void read(std::istream& is) {
+		std::string s;
+
+		for (int n = 1; std::getline(is, s); n++) {
+			std::istringstream line(s.substr(0, s.find('#')));
+			rule r;
+
+			std::string rest;
+
+			if (!(line >> r.prefix))
+				continue; // blank
+			if (!(line >> r.threshold) || line >> rest)
+				throw std::invalid_argument("invalid threshold at line " + detail::lexical_cast<std::string>(n));
+			if (!(r.threshold >= 0.0 && r.threshold <= 100.0))
+				throw std::invalid_argument("threshold out of 0-100 at line " + detail::lexical_cast<std::string>(n));
+			rules_.push_back(r);
+		}
+
+		// an empty gate would always pass
+		if (rules_.empty())
+			throw std::invalid_argument("no threshold in config");
+	}
+
+	const std::vector<rule>& rules(void) const {
+		return rules_;
+	}
+
+	static bool matches(const std::string& prefix, const std::string& source_file) {
+		if (prefix == "*")
+			return true;
+		if (source_file.compare(0, prefix.length(), prefix) != 0)
+			return false;
+		// "src/foo" matches src/foo/bar.c but not src/foobar.c
+		return prefix[prefix.length() - 1] == '/' || source_file.length() == prefix.length() ||
+			source_file[prefix.length()] == '/' || source_file[prefix.length()] == '\\';
+	}
+
+private:
+	std::vector<rule> rules_;
+};
+
+struct threshold_result {
+	std::string prefix;
+	double      threshold;
+	int         files;
+	int         lines_executed;
+	int         lines_total;
+	bool        passed;
 };
 
 //-------------------------------------------------
@@ -477,6 +1360,117 @@ std::vector<coverage_data> parse (int num, const char *path[]) {
 	return sources;
 }
 
+// count lines of .gcov file without keeping its source text
+line_count count (const char* gcov_file_name) {
+	std::ifstream ifs(gcov_file_name);
+	count_parser<std::ifstream> p(gcov_file_name);
+
+	if (ifs.fail()) 
+		throw std::invalid_argument(std::string("failed to open file ") + gcov_file_name);
+
+	return p.parse();
+}
+
+// count lines of merged lcov tracefiles (.info) without reading the sources
+std::vector<line_count> count_lcov (int num, const char *path[]) {
+	lcov_parser<std::ifstream> p;
+
+	for (int i = 0; i < num; i++)
+		p.parse(path[i]);
+
+	return p.counts();
+}
+
+// load threshold config file
+threshold_config load_thresholds (const char* config_file_name) {
+	std::ifstream ifs(config_file_name);
+	threshold_config config;
+
+	if (ifs.fail()) 
+		throw std::invalid_argument(std::string("failed to open file ") + config_file_name);
+
+	config.read(ifs);
+	return config;
+}
+
+// aggregate line counts for each rule of config. a rule matching no files fails,
+// since it is most likely a typo or a path written relative to the wrong root.
+std::vector<threshold_result> check_thresholds(const std::vector<line_count>& counts, const threshold_config& config) {
+	std::vector<threshold_result> results;
+
+	for (std::vector<threshold_config::rule>::const_iterator r = config.rules().begin(); r != config.rules().end(); ++r) {
+		threshold_result result = { r->prefix, r->threshold, 0, 0, 0, false };
+
+		for (std::vector<line_count>::const_iterator c = counts.begin(), end = counts.end(); c != end; ++c) {
+			if (threshold_config::matches(r->prefix, c->source_file)) {
+				result.files++;
+				result.lines_executed += c->lines_executed;
+				result.lines_total    += c->lines_total;
+			}
+		}
+		if (result.files > 0)
+			result.passed = result.lines_total == 0 || 100.0 * result.lines_executed / result.lines_total >= r->threshold;
+		results.push_back(result);
+	}
+	return results;
+}
+
+// write results of check_thresholds as json, returns false on any violation
+bool write_check_result(FILE *fp, const std::vector<line_count>& counts, const std::vector<threshold_result>& results) {
+	int executed = 0, total = 0;
+	bool passed = true;
+
+	for (std::vector<line_count>::const_iterator c = counts.begin(), end = counts.end(); c != end; ++c) {
+		executed += c->lines_executed;
+		total    += c->lines_total;
+	}
+	for (std::vector<threshold_result>::const_iterator r = results.begin(), end = results.end(); r != end; ++r)
+		passed = passed && r->passed;
+
+	fprintf(fp,
+		"{\"passed\":%s,\"files\":%d,\"lines_executed\":%d,\"lines_total\":%d,\"checks\":[",
+		passed ? "true" : "false", (int)counts.size(), executed, total);
+
+	for (std::vector<threshold_result>::const_iterator r = results.begin(), end = results.end(); r != end; ++r) {
+		fprintf(fp,
+			"%s\n  {\"path\":\"%s\",\"matched\":%s,\"files\":%d,\"threshold\":%.2f,\"lines_executed\":%d,\"lines_total\":%d,\"line_coverage\":%.2f,\"passed\":%s}",
+			r == results.begin() ? "" : ",",
+			detail::escape_for_json(r->prefix).c_str(),
+			r->files > 0 ? "true" : "false",
+			r->files,
+			r->threshold,
+			r->lines_executed,
+			r->lines_total,
+			r->lines_total == 0 ? 0.0 : 100.0 * r->lines_executed / r->lines_total,
+			r->passed ? "true" : "false");
+	}
+	fprintf(fp, "]}\n");
+
+	return passed;
+}
+
+// parse lcov tracefiles (.info) and merge them
+std::vector<coverage_data> parse_lcov (int num, const char *path[]) {
+	lcov_parser<std::ifstream> p;
+
+	for (int i = 0; i < num; i++)
+		p.parse(path[i]);
+
+	return p.result();
+}
+
+// parse lcov tracefiles (.info), merge them and pass the coverage of each
+// source file to f, so only one source is in memory at a time
+template<class Function>
+void parse_lcov (int num, const char *path[], Function& f) {
+	lcov_parser<std::ifstream> p;
+
+	for (int i = 0; i < num; i++)
+		p.parse(path[i]);
+
+	p.for_each(f);
+}
+
 // generage html report file from coverage_data
 void generate_coverage_report(const coverage_data& src, const std::string& path) {
 	report_generator w(path);
@@ -491,6 +1485,20 @@ void generate_coverage_report(const coverage_data& coverage) {
 	generate_coverage_report(coverage, path);
 }
 
+// generage html report file with uncovered lines only, linking to the full report
+void generate_uncovered_report(const coverage_data& coverage, int context_lines) {
+	const std::string path = detail::get_filebase(coverage.parse_file()) + ".html";
+	// both pages are written next to the input, so the link is relative to that directory
+	uncovered_report_generator w(path, context_lines, detail::get_filename(detail::get_full_report_file(coverage.parse_file())));
+
+	w.write(coverage);
+}
+
+// generage full html report file linked from generate_uncovered_report
+void generate_full_report(const coverage_data& coverage) {
+	generate_coverage_report(coverage, detail::get_full_report_file(coverage.parse_file()));
+}
+
 // generage html summary file from coverage_data array
 void generate_coverage_summary(const std::vector<coverage_data>& coverages, const std::string& path = "index.html") {
 	gcovh::summary_generator summary(path);
@@ -498,4 +1506,13 @@ void generate_coverage_summary(const std::vector<coverage_data>& coverages, cons
 	summary.write(coverages);
 }
 
+// generage html summary file with trends of the last trend_length builds in history
+void generate_coverage_summary(const std::vector<coverage_data>& coverages, const coverage_history& history,
+	size_t trend_length = 16, const std::string& path = "index.html") {
+	gcovh::summary_generator summary(path);
+
+	summary.set_history(&history, trend_length);
+	summary.write(coverages);
+}
+
 } // namespace gcovh
@@ -27,6 +27,14 @@
 #include "gcovh.h"
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <iterator>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
 
 using namespace std;
 
@@ -175,8 +183,374 @@ int test3(void) {
 	return 0;
 }
 
+struct source_counter {
+	source_counter() : sources(0), lines(0) {}
+
+	void operator () (const gcovh::coverage_data& cov) {
+		sources++;
+		lines += cov.lines_total();
+	}
+
+	int sources;
+	int lines;
+};
+
+int test4(void) {
+	std::string s1 =
+		"TN:\n"
+		"SF:no/such/dir/foo.c\n"
+		"FN:3,main\n"
+		"FN:8,unused\n"
+		"FNDA:1,main\n"
+		"FNDA:0,unused\n"
+		"BRDA:4,0,0,1\n"
+		"BRDA:4,0,1,-\n"
+		"DA:3,1\n"
+		"DA:4,1\n"
+		"DA:5,0\n"
+		"DA:9,0\n"
+		"end_of_record\n";
+	std::string s2 =
+		"SF:no/such/dir/foo.c\n"
+		"BRDA:4,0,1,2\n"
+		"DA:5,2\n"
+		"end_of_record\n"
+		"SF:no/such/dir/bar.c\n"
+		"DA:1,0\n"
+		"end_of_record\n";
+
+	gcovh::lcov_parser<std::istringstream> p;
+
+	p.parse(s1);
+	p.parse(s2);
+
+	source_counter counter;
+
+	p.for_each(counter);
+
+	TEST(counter.sources, 2);
+	TEST(counter.lines, 5);
+
+	std::vector<gcovh::coverage_data> srcs = p.result();
+
+	TEST((int)srcs.size(), 2);
+	TEST(srcs[0].source_file(), std::string("no/such/dir/bar.c"));
+	TEST(srcs[0].lines_executed(), 0);
+	TEST(srcs[0].lines_total(), 1);
+
+	gcovh::coverage_data src = srcs[1];
+
+	TEST(src.source_file(), std::string("no/such/dir/foo.c"));
+	TEST(src.parse_file(), std::string("no_such_dir_foo.c.gcov"));
+	TEST(src.lines_executed(), 3);
+	TEST(src.lines_total(), 4);
+	TEST(src.functions_executed(), 1);
+	TEST(src.functions_total(), 2);
+	TEST(src.branches_taken(), 2);
+	TEST(src.branches_total(), 2);
+
+	gcovh::source_lines lines = src.all();
+
+	TEST((int)lines.size(), 4);
+	TEST(lines[0].number(), 3);
+	TEST(lines[2].exec_count(), "2");
+	TEST(lines[3].exec_count(), "#####");
+	TEST(lines[3].executed(), false);
+
+	gcovh::generate_coverage_report(src, "test4.out.html");
+
+	src.clear_source();
+
+	TEST((int)src.all().size(), 0);
+	TEST(src.lines_executed(), 3);
+	TEST(src.lines_total(), 4);
+
+	return 0;
+}
+
+int test5(void) {
+	std::vector<gcovh::coverage_data> run;
+
+	for (int i = 0; i < 2; i++) {
+		gcovh::parser<std::istringstream> p(i == 0 ?
+			"        -:    0:Source:foo.c\n"
+			"        1:    1:int foo (void) {\n"
+			"    #####:    2:    return 0;\n" :
+			"        -:    0:Source:bar.c\n"
+			"        1:    1:int bar (void) {\n");
+		run.push_back(p.parse());
+	}
+
+	remove("test5.out.history");
+
+	gcovh::coverage_history history("test5.out.history");
+
+	TEST((int)history.builds(), 0);
+
+	history.append("build-1", run);
+	run.pop_back();
+	history.append("build-2", run);
+
+	gcovh::coverage_history reloaded("test5.out.history");
+
+	TEST((int)reloaded.builds(), 2);
+	TEST(reloaded.build_id(1), std::string("build-2"));
+
+	std::vector<gcovh::coverage_history::point> trend = reloaded.trend("foo.c", 16);
+
+	TEST((int)trend.size(), 2);
+	TEST(trend[0].found, true);
+	TEST(trend[0].lines_executed, 1);
+	TEST(trend[0].lines_total, 2);
+	TEST(trend[1].build_id, std::string("build-2"));
+
+	trend = reloaded.trend("bar.c", 1);
+
+	TEST((int)trend.size(), 1);
+	TEST(trend[0].found, false);
+	TEST(reloaded.find(0, "bar.c").lines_total, 1);
+
+	gcovh::generate_coverage_summary(run, reloaded, 16, "test5.out.html");
+
+	// a file listed twice, as a header from two translation units, is recorded as the sum
+	std::vector<gcovh::coverage_data> twice(2, run[0]);
+
+	reloaded.append("build-twice", twice);
+
+	TEST(reloaded.find(2, "foo.c").lines_executed, 2);
+	TEST(reloaded.find(2, "foo.c").lines_total, 4);
+
+	// a build id is never truncated
+	bool rejected = false;
+	try {
+		reloaded.append("0123456789abcdef0123456789abcdef01234567", run);
+	} catch (const std::invalid_argument&) {
+		rejected = true;
+	}
+	TEST(rejected, true);
+	TEST((int)reloaded.builds(), 3);
+
+	// a block torn by an interrupted append is dropped by the next append
+	FILE *fp = fopen("test5.out.history", "ab");
+	fwrite("GCVH-broken", 1, 11, fp);
+	fclose(fp);
+
+	gcovh::coverage_history damaged("test5.out.history");
+
+	TEST((int)damaged.builds(), 3);
+
+	damaged.append("build-3", run);
+
+	TEST((int)damaged.builds(), 4);
+	TEST(gcovh::coverage_history("test5.out.history").build_id(3), std::string("build-3"));
+
+	// damage before the last block is reported, never cut off
+	fp = fopen("test5.out.history", "r+b");
+	fseek(fp, 32 + 2 * 16, SEEK_SET); // the block of build-2
+	fwrite("XXXX", 1, 4, fp);
+	fclose(fp);
+
+	bool reported = false;
+	try {
+		gcovh::coverage_history broken("test5.out.history");
+	} catch (const std::runtime_error&) {
+		reported = true;
+	}
+	TEST(reported, true);
+
+#ifndef _WIN32
+	// concurrent appends are serialized by the lock
+	remove("test5.out.history");
+
+	pid_t child = fork();
+	gcovh::coverage_history shared("test5.out.history");
+
+	for (int i = 0; i < 20; i++)
+		shared.append(child == 0 ? "child" : "parent", run);
+	if (child == 0)
+		_exit(0);
+	waitpid(child, 0, 0);
+
+	TEST((int)gcovh::coverage_history("test5.out.history").builds(), 40);
+#endif
+
+	return 0;
+}
+
+int test6(void) {
+	std::string s =
+		"        -:    0:Source:foo.c\n"
+		"        1:    1:int foo (int n) {\n"
+		"        1:    2:    int r = 0;\n"
+		"        1:    3:    if (n < 0)\n"
+		"    #####:    4:        r = -n;\n"
+		"        1:    5:    r += 1;\n"
+		"        1:    6:    r += 2;\n"
+		"        1:    7:    return r;\n"
+		"        -:    8:}\n";
+
+	gcovh::parser<std::istringstream> p(s);
+
+	gcovh::coverage_data src = p.parse();
+
+	{
+		gcovh::uncovered_report_generator w("test6.out.html", 1, "test6.full.html");
+		w.write(src);
+	}
+
+	std::ifstream ifs("test6.out.html");
+	std::string html((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+	TEST(html.find("Lines executed:6 of 7") != std::string::npos, true);
+	TEST(html.find("#####:        r = -n;") != std::string::npos, true);
+	TEST(html.find("r += 1;") != std::string::npos, true);
+	TEST(html.find("r += 2;") != std::string::npos, false);
+	TEST(html.find("href=\"test6.full.html#L1\">... lines 1-2 ...") != std::string::npos, true);
+	TEST(html.find("href=\"test6.full.html#L6\">... lines 6-8 ...") != std::string::npos, true);
+
+	// pages of an input in another directory link to each other by file name
+#ifdef _WIN32
+	_mkdir("test6.out.d");
+#else
+	mkdir("test6.out.d", 0755);
+#endif
+	{
+		std::ofstream ofs("test6.out.d/foo.c.gcov");
+		ofs << s;
+	}
+
+	src = gcovh::parse("test6.out.d/foo.c.gcov");
+	gcovh::generate_uncovered_report(src, 0);
+	gcovh::generate_full_report(src);
+
+	std::ifstream sub("test6.out.d/foo.c.html");
+	std::string sub_html((std::istreambuf_iterator<char>(sub)), std::istreambuf_iterator<char>());
+
+	TEST(sub_html.find("href=\"foo.c.full.html#L1\">... lines 1-3 ...") != std::string::npos, true);
+	TEST(std::ifstream("test6.out.d/foo.c.full.html").good(), true);
+
+	return 0;
+}
+
+int test7(void) {
+	const char *gcov[] = {
+		"        -:    0:Source:src/foo.c\n"
+		"        -:    1:#include <stdio.h>\n"
+		"        1:    2:int main (void) {\n"
+		"    #####:    3:    printf(\"a:b\");\n"
+		"        1:    4:    return 0;\n"
+		"        -:    5:}\n",
+		"        -:    0:Source:src/foobar.c\n"
+		"function bar called 0 returned 0% blocks executed 0%\n"
+		"    #####:    1:int bar (void) {\n"
+		"branch  0 never executed\n",
+		"        -:    0:Source:lib/baz.c\n"
+		"       10:    1:int baz (void) {\n"
+	};
+	std::vector<gcovh::line_count> counts;
+
+	for (int i = 0; i < 3; i++) {
+		gcovh::parser<std::istringstream> p(gcov[i]);
+		gcovh::count_parser<std::istringstream> c(gcov[i]);
+		gcovh::coverage_data src = p.parse();
+
+		counts.push_back(c.parse());
+		TEST(counts[i].source_file, src.source_file());
+		TEST(counts[i].lines_executed, src.lines_executed());
+		TEST(counts[i].lines_total, src.lines_total());
+	}
+
+	std::istringstream config(
+		"# thresholds\n"
+		"*        50\n"
+		"\n"
+		"src      40 # src/foo.c and src/foobar.c\n"
+		"src/foo  100 # no file is under src/foo/\n"
+		"lib/     100\n");
+	gcovh::threshold_config thresholds;
+
+	thresholds.read(config);
+
+	// configs a gate cannot trust are rejected
+	const char *invalid[] = { "", "# nothing\n\n", "src 40abc\n", "src 40 50\n", "src\n", "src -1\n", "src 100.5\n" };
+
+	for (int i = 0; i < 7; i++) {
+		std::istringstream is(invalid[i]);
+		gcovh::threshold_config c;
+		bool rejected = false;
+
+		try {
+			c.read(is);
+		} catch (const std::invalid_argument&) {
+			rejected = true;
+		}
+		TEST(rejected, true);
+	}
+
+	TEST(gcovh::detail::escape_for_json("a\"b\\c\td\x01"), std::string("a\\\"b\\\\c\\u0009d\\u0001"));
+
+	std::vector<gcovh::threshold_result> results = gcovh::check_thresholds(counts, thresholds);
+
+	TEST((int)results.size(), 4);
+	TEST(results[0].files, 3);
+	TEST(results[0].lines_executed, 3);
+	TEST(results[0].lines_total, 5);
+	TEST(results[0].passed, true);
+	TEST(results[1].lines_executed, 2);
+	TEST(results[1].lines_total, 4);
+	TEST(results[1].passed, true);
+	TEST(results[2].files, 0);
+	TEST(results[2].passed, false);
+	TEST(results[3].lines_executed, 1);
+	TEST(results[3].passed, true);
+
+	counts[2].lines_executed = 0;
+	results = gcovh::check_thresholds(counts, thresholds);
+
+	TEST(results[2].passed, false);
+	TEST(results[3].passed, false);
+
+	FILE *fp = fopen("test7.out.json", "w");
+	TEST(gcovh::write_check_result(fp, counts, results), false);
+	fclose(fp);
+
+	return 0;
+}
+
+int test8(void) {
+	// lcov 2.x writes end lines in FN, 2.2 uses FNL/FNA instead
+	std::string s =
+		"SF:no/such/dir/foo.c\n"
+		"FN:3,9,main\n"
+		"FNDA:1,main\n"
+		"FN:12,foo(int, char)\n"
+		"FNDA:1,foo(int, char)\n"
+		"FN:20,24,bar(int, char)\n"
+		"end_of_record\n"
+		"SF:no/such/dir/bar.c\n"
+		"FNL:0,3,9\n"
+		"FNA:0,2,bar\n"
+		"FNL:1,10,12\n"
+		"FNA:1,0,unused\n"
+		"end_of_record\n";
+
+	gcovh::lcov_parser<std::istringstream> p;
+
+	p.parse(s);
+
+	std::vector<gcovh::coverage_data> srcs = p.result();
+
+	TEST((int)srcs.size(), 2);
+	TEST(srcs[0].functions_executed(), 1);
+	TEST(srcs[0].functions_total(), 2);
+	TEST(srcs[1].functions_executed(), 2);
+	TEST(srcs[1].functions_total(), 3);
+
+	return 0;
+}
+
 int main (int argc, char *argv[]) {
-	if (test1() || test2() || test3()) {
+	if (test1() || test2() || test3() || test4() || test5() || test6() || test7() || test8()) {
 		return -1;
 	}
 	return 0;